@@ -0,0 +1,86 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget
+// Licensed under the MIT license. See the LICENSE file for details.
+
+// Compares the time per wait of PROC_WAIT_FOR(sim->timeout(delay)) and
+// PROC_WAIT_DELAY(delay) in the hold model: a fixed population of processes
+// which repeatedly wait for a random delay. Both variants draw the same
+// delays, so they process the same sequence of waits.
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include "simcpp.h"
+
+const size_t n = 10000;
+const size_t waits = 5000000;
+
+class TimeoutHolder : public simcpp::Process {
+public:
+  TimeoutHolder(simcpp::SimulationPtr sim, std::mt19937_64 *rng)
+      : Process(sim), rng(rng) {}
+
+  bool Run() override {
+    auto sim = this->sim.lock();
+
+    PT_BEGIN();
+    while (true) {
+      PROC_WAIT_FOR(sim->timeout(delay(*rng)));
+    }
+    PT_END();
+  }
+
+private:
+  std::mt19937_64 *rng;
+  std::exponential_distribution<simcpp::simtime> delay;
+};
+
+class DelayHolder : public simcpp::Process {
+public:
+  DelayHolder(simcpp::SimulationPtr sim, std::mt19937_64 *rng)
+      : Process(sim), rng(rng) {}
+
+  bool Run() override {
+    PT_BEGIN();
+    while (true) {
+      PROC_WAIT_DELAY(delay(*rng));
+    }
+    PT_END();
+  }
+
+private:
+  std::mt19937_64 *rng;
+  std::exponential_distribution<simcpp::simtime> delay;
+};
+
+// Start n processes and process their start entries, after which every
+// process waits. Then time the next queue entries, each of which ends one
+// wait. Returns the nanoseconds per wait.
+template <typename T> double bench(simcpp::SimulationPtr sim) {
+  std::mt19937_64 rng(1);
+  for (size_t i = 0; i < n; ++i) {
+    sim->start_process<T>(&rng);
+  }
+  while (sim->get_step_count() < n) {
+    sim->step();
+  }
+
+  simcpp::StopPolicy policy;
+  policy.max_events = waits;
+  auto start = std::chrono::steady_clock::now();
+  sim->run(policy);
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - start).count() / waits;
+}
+
+int main() {
+  double timeout = bench<TimeoutHolder>(simcpp::Simulation::create());
+  double delay = bench<DelayHolder>(simcpp::Simulation::create());
+
+  printf("PROC_WAIT_FOR(sim->timeout(d)): %6.1f ns per wait\n", timeout);
+  printf("PROC_WAIT_DELAY(d):             %6.1f ns per wait\n", delay);
+  printf("Speedup:                        %6.2fx\n", timeout / delay);
+
+  return 0;
+}
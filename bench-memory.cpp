@@ -0,0 +1,104 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget
+// Licensed under the MIT license. See the LICENSE file for details.
+
+// Compares the memory used per waiting process by simcpp::Process and by
+// simcpp::CompactProcess. Heap usage is measured by tracking the bytes
+// currently allocated through the global operator new.
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "compact.h"
+#include "simcpp.h"
+
+static size_t allocated = 0;
+
+// Each block is prefixed with its size, so that operator delete can subtract
+// it again. The prefix keeps the maximum fundamental alignment.
+static const size_t prefix = alignof(std::max_align_t);
+
+void *operator new(size_t size) {
+  char *p = static_cast<char *>(std::malloc(size + prefix));
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  *reinterpret_cast<size_t *>(p) = size;
+  allocated += size;
+  return p + prefix;
+}
+
+void operator delete(void *p) noexcept {
+  if (p == nullptr) {
+    return;
+  }
+  char *block = static_cast<char *>(p) - prefix;
+  allocated -= *reinterpret_cast<size_t *>(block);
+  std::free(block);
+}
+
+class Walker : public simcpp::Process {
+public:
+  explicit Walker(simcpp::SimulationPtr sim) : Process(sim) {}
+
+  bool Run() override {
+    PT_BEGIN();
+    PROC_WAIT_DELAY(1.0);
+    PT_END();
+  }
+};
+
+class CompactWalker : public simcpp::CompactProcess {
+public:
+  bool Run(simcpp::CompactContext &context) {
+    CPROC_BEGIN();
+    CPROC_WAIT_DELAY(context, 1.0);
+    CPROC_END();
+  }
+};
+
+const size_t n = 1000000;
+
+// Both benchmarks start n processes and process the start entry, after which
+// every process waits for a delay. The memory still allocated at that point
+// is what a population of n waiting processes costs.
+
+void bench_process() {
+  size_t before = allocated;
+  auto sim = simcpp::Simulation::create();
+  sim->reserve(n);
+  {
+    std::vector<simcpp::ProcessPtr> processes;
+    processes.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      processes.push_back(std::make_shared<Walker>(sim));
+    }
+    sim->run_processes(processes.begin(), processes.end());
+  }
+  sim->step();
+
+  printf("simcpp::Process:        sizeof %3zu, %6.1f bytes per process\n",
+         sizeof(Walker), static_cast<double>(allocated - before) / n);
+}
+
+void bench_compact() {
+  size_t before = allocated;
+  auto sim = simcpp::Simulation::create();
+  auto pool = simcpp::CompactProcessPool<CompactWalker>::create(sim);
+  pool->reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    pool->start();
+  }
+  sim->step();
+
+  printf("simcpp::CompactProcess: sizeof %3zu, %6.1f bytes per process\n",
+         sizeof(CompactWalker), static_cast<double>(allocated - before) / n);
+}
+
+int main() {
+  bench_process();
+  bench_compact();
+
+  return 0;
+}
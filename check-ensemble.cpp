@@ -0,0 +1,126 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget
+// Licensed under the MIT license. See the LICENSE file for details.
+
+// Checks that every lane of a CompactEnsemble resumes its processes in the
+// same order and at the same times as a CompactProcessPool holding the same
+// processes in an independent simulation. The processes wait with delay 0 and
+// with small integer delays, so many wake-up times are tied and the order
+// depends on the scheduling ids. The number of lanes is not a multiple of
+// four, so both the AVX2 path and the scalar tail of the selection are used
+// when compiled with -mavx2. Exits with status 1 if a lane differs.
+
+#include <cstdio>
+#include <vector>
+
+#include "compact.h"
+#include "ensemble.h"
+
+class Visit {
+public:
+  simcpp::simtime time;
+  uint32_t index;
+
+  bool operator!=(const Visit &other) const {
+    return time != other.time || index != other.index;
+  }
+};
+
+class Worker : public simcpp::CompactProcess {
+public:
+  Worker(std::vector<Visit> *log, int period, int rounds)
+      : log(log), period(period), rounds(rounds) {}
+
+  bool Run(simcpp::CompactContext &context) {
+    CPROC_BEGIN();
+    while (rounds > 0) {
+      --rounds;
+      log->push_back({context.get_now(), context.get_index()});
+      CPROC_WAIT_DELAY(context, 0.0);
+      log->push_back({context.get_now(), context.get_index()});
+      CPROC_WAIT_DELAY(context, period);
+    }
+    CPROC_END();
+  }
+
+private:
+  std::vector<Visit> *log;
+  int period;
+  int rounds;
+};
+
+const size_t lanes = 37;
+const uint32_t processes = 6;
+const simcpp::simtime split = 4.0;
+
+Worker make_worker(std::vector<Visit> *log, size_t lane, uint32_t process) {
+  int period = 1 + static_cast<int>((lane + process) % 3);
+  int rounds = 3 + static_cast<int>((lane * 7 + process) % 5);
+  return Worker(log, period, rounds);
+}
+
+// Run one lane in a simulation of its own, stopping once at split like the
+// ensemble.
+std::vector<Visit> run_pool(size_t lane, simcpp::simtime &now_at_split) {
+  std::vector<Visit> log;
+  auto sim = simcpp::Simulation::create();
+  auto pool = simcpp::CompactProcessPool<Worker>::create(sim);
+  for (uint32_t process = 0; process < processes; ++process) {
+    pool->start(make_worker(&log, lane, process));
+  }
+  sim->advance_by(split);
+  now_at_split = sim->get_now();
+  sim->run();
+  return log;
+}
+
+int main() {
+  std::vector<std::vector<Visit>> logs(lanes);
+  simcpp::CompactEnsemble<Worker> ensemble(
+      lanes, processes, [&logs](size_t lane, uint32_t process) {
+        return make_worker(&logs[lane], lane, process);
+      });
+  ensemble.run_until(split);
+  std::vector<simcpp::simtime> now_at_split(lanes);
+  for (size_t lane = 0; lane < lanes; ++lane) {
+    now_at_split[lane] = ensemble.get_now(lane);
+  }
+  ensemble.run();
+
+  size_t matched = 0;
+  for (size_t lane = 0; lane < lanes; ++lane) {
+    simcpp::simtime expected_now;
+    auto expected = run_pool(lane, expected_now);
+    auto &actual = logs[lane];
+
+    bool same = expected.size() == actual.size() &&
+                expected_now == now_at_split[lane];
+    for (size_t i = 0; same && i < expected.size(); ++i) {
+      if (expected[i] != actual[i]) {
+        printf("lane %zu differs at visit %zu: expected process %u at %g, "
+               "got process %u at %g\n",
+               lane, i, expected[i].index, expected[i].time, actual[i].index,
+               actual[i].time);
+        same = false;
+      }
+    }
+    if (same) {
+      ++matched;
+    } else if (expected.size() != actual.size()) {
+      printf("lane %zu differs: expected %zu visits, got %zu\n", lane,
+             expected.size(), actual.size());
+    } else if (expected_now != now_at_split[lane]) {
+      printf("lane %zu differs: expected time %g at split, got %g\n", lane,
+             expected_now, now_at_split[lane]);
+    }
+  }
+
+#ifdef __AVX2__
+  const char *path = "AVX2";
+#else
+  const char *path = "scalar";
+#endif
+  printf("%s selection: %zu of %zu lanes match independent pools\n", path,
+         matched, lanes);
+
+  return matched == lanes ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#include "compact.h"
+
+#include <algorithm>
+
+namespace simcpp {
+
+/* CompactContext */
+
+CompactContext::CompactContext(simtime now, uint32_t index)
+    : now(now), index(index) {}
+
+simtime CompactContext::get_now() { return now; }
+
+uint32_t CompactContext::get_index() { return index; }
+
+void CompactContext::wait_delay(simtime delay) {
+  waiting = true;
+  this->delay = delay;
+}
+
+bool CompactContext::is_waiting() { return waiting; }
+
+simtime CompactContext::get_delay() { return delay; }
+
+/* CompactScheduler */
+
+CompactScheduler::CompactScheduler(SimulationPtr sim)
+    : sim(sim), now(sim->get_now()) {}
+
+simtime CompactScheduler::get_now() {
+  auto sim = this->sim.lock();
+  return sim->get_now();
+}
+
+size_t CompactScheduler::get_waiting_count() { return queue.size(); }
+
+void CompactScheduler::reserve_queue(size_t capacity) {
+  queue.reserve(capacity);
+}
+
+void CompactScheduler::schedule(uint32_t index, simtime delay) {
+  // Outside of an activation, the clock may be behind the simulation.
+  if (!activating) {
+    now = get_now();
+  }
+
+  Entry entry;
+  entry.time = now + delay;
+  entry.id = next_id;
+  entry.index = index;
+  queue.push_back(entry);
+  std::push_heap(queue.begin(), queue.end());
+  ++next_id;
+
+  schedule_activation();
+}
+
+void CompactScheduler::schedule_activation() {
+  if (!queue.empty()) {
+    Activation::schedule(activation, sim, this, &CompactScheduler::activate,
+                         queue.front().time);
+  }
+}
+
+bool CompactScheduler::activate(simtime time, simtime &next) {
+  now = time;
+
+  activating = true;
+  while (!queue.empty() && queue.front().time <= time) {
+    std::pop_heap(queue.begin(), queue.end());
+    uint32_t index = queue.back().index;
+    queue.pop_back();
+
+    CompactContext context(now, index);
+    bool still_running = resume(context);
+    if (context.is_waiting()) {
+      schedule(index, context.get_delay());
+    }
+    if (!still_running) {
+      --running;
+    }
+  }
+  activating = false;
+
+  if (queue.empty()) {
+    return false;
+  }
+  next = queue.front().time;
+  return true;
+}
+
+/* CompactScheduler::Entry */
+
+bool CompactScheduler::Entry::operator<(const Entry &other) const {
+  if (time != other.time) {
+    return time > other.time;
+  }
+
+  return id > other.id;
+}
+
+} // namespace simcpp
@@ -0,0 +1,297 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#ifndef SIMCPP_COMPACT_H_
+#define SIMCPP_COMPACT_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "simcpp.h"
+
+/// Declare the start of the Run method of a compact process.
+#define CPROC_BEGIN()                                                          \
+  switch (get_continuation()) {                                                \
+  case 0:
+
+/// Declare the end of the Run method of a compact process.
+#define CPROC_END()                                                            \
+  default:;                                                                    \
+  }                                                                            \
+  finish();                                                                    \
+  return false
+
+/**
+ * Pause a compact process for a delay inside its Run method.
+ *
+ * The continuation is stored in 16 bits, so the macro must be used before
+ * line 65536 of its source file.
+ *
+ * @param context Context passed to the Run method.
+ * @param delay Delay after which the process is resumed.
+ */
+#define CPROC_WAIT_DELAY(context, delay)                                       \
+  do {                                                                         \
+    static_assert(__LINE__ <= 0xffff,                                          \
+                  "CPROC_WAIT_DELAY must be used before line 65536");          \
+    (context).wait_delay(delay);                                               \
+    set_continuation(__LINE__);                                                \
+    return true;                                                               \
+  case __LINE__:;                                                              \
+  } while (0)
+
+namespace simcpp {
+
+/**
+ * Base class of processes stored by value in a CompactProcessPool.
+ *
+ * A compact process has no virtual methods and no pointers. Its kernel state
+ * is a single 32-bit word holding the continuation (the line of the last
+ * CPROC_WAIT_DELAY) and whether the process has finished. The process is
+ * identified by its 32-bit index in the pool and reaches the simulation
+ * through the CompactContext passed to its Run method.
+ *
+ * Subclasses implement a non-virtual `bool Run(simcpp::CompactContext &)`
+ * using CPROC_BEGIN, CPROC_WAIT_DELAY and CPROC_END. Like protothreads,
+ * local variables of Run are not kept across waits.
+ */
+class CompactProcess {
+public:
+  /// @return Whether the process has not finished yet.
+  bool is_running() const { return (word & finished_flag) == 0; }
+
+protected:
+  /// @return Line at which Run continues.
+  uint16_t get_continuation() const {
+    return static_cast<uint16_t>(word & continuation_mask);
+  }
+
+  /// @param line Line at which Run continues.
+  void set_continuation(uint16_t line) {
+    word = (word & ~continuation_mask) | line;
+  }
+
+  /// Mark the process as finished.
+  void finish() { word |= finished_flag; }
+
+private:
+  static const uint32_t continuation_mask = 0xffff;
+  static const uint32_t finished_flag = 1u << 16;
+
+  uint32_t word = 0;
+};
+
+/**
+ * Access to the simulation from the Run method of a compact process.
+ *
+ * The context only records a requested delay. The owner of the process
+ * (a CompactProcessPool or a CompactEnsemble) schedules the process after Run
+ * returns.
+ */
+class CompactContext {
+public:
+  /**
+   * Construct a context.
+   *
+   * @param now Current simulation time.
+   * @param index Index of the process.
+   */
+  CompactContext(simtime now, uint32_t index);
+
+  /// @return Current simulation time.
+  simtime get_now();
+
+  /// @return Index of the process in its pool.
+  uint32_t get_index();
+
+  /**
+   * Request the process to be resumed after a delay. Used by
+   * CPROC_WAIT_DELAY.
+   *
+   * @param delay Delay after which the process is resumed.
+   */
+  void wait_delay(simtime delay);
+
+  /// @return Whether the process requested to be resumed.
+  bool is_waiting();
+
+  /// @return Requested delay. Only meaningful if is_waiting().
+  simtime get_delay();
+
+private:
+  simtime now;
+  uint32_t index;
+  bool waiting = false;
+  simtime delay = 0.0;
+};
+
+/**
+ * Event queue of compact processes.
+ *
+ * The queue only holds entries of waiting processes. Like a sub-simulation
+ * (see Simulation::create_sub_simulation), it is represented in the
+ * simulation by a single Activation for its earliest entry, and by none while
+ * no process is waiting.
+ */
+class CompactScheduler : public std::enable_shared_from_this<CompactScheduler> {
+public:
+  /**
+   * Construct a scheduler.
+   *
+   * @param sim Simulation instance.
+   */
+  explicit CompactScheduler(SimulationPtr sim);
+
+  virtual ~CompactScheduler() = default;
+
+  /// @return Current simulation time.
+  simtime get_now();
+
+  /// @return Number of processes waiting to be resumed.
+  size_t get_waiting_count();
+
+protected:
+  /// Number of processes which have not finished yet.
+  size_t running = 0;
+
+  /**
+   * Reserve space in the queue.
+   *
+   * @param capacity Number of queue entries to reserve space for.
+   */
+  void reserve_queue(size_t capacity);
+
+  /**
+   * Schedule a process to be resumed after a delay.
+   *
+   * @param index Index of the process.
+   * @param delay Delay after which the process is resumed.
+   */
+  void schedule(uint32_t index, simtime delay);
+
+  /**
+   * Resume a process.
+   *
+   * @param context Context of the process.
+   * @return Whether the process is still running.
+   */
+  virtual bool resume(CompactContext &context) = 0;
+
+private:
+  class Entry {
+  public:
+    simtime time;
+    uint64_t id;
+    uint32_t index;
+
+    bool operator<(const Entry &other) const;
+  };
+
+  SimulationWeakPtr sim;
+  simtime now = 0.0;
+  uint64_t next_id = 0;
+  std::vector<Entry> queue;
+  ActivationWeakPtr activation;
+  // Whether now is the time of the activation being processed.
+  bool activating = false;
+
+  void schedule_activation();
+
+  // Resume all processes which are due at the activation time. Used as
+  // Activation::Callback.
+  bool activate(simtime time, simtime &next);
+};
+
+/**
+ * Pool of compact processes of one type.
+ *
+ * The processes are stored by value, so the memory used per process is the
+ * size of T, which includes 4 bytes of kernel state, plus a 24-byte queue
+ * entry while the process is waiting.
+ *
+ * @tparam T Process class. Must be a subclass of CompactProcess.
+ */
+template <typename T> class CompactProcessPool : public CompactScheduler {
+public:
+  /**
+   * Create a pool.
+   *
+   * @param sim Simulation instance.
+   * @return Pool instance.
+   */
+  static std::shared_ptr<CompactProcessPool<T>> create(SimulationPtr sim) {
+    return std::make_shared<CompactProcessPool<T>>(sim);
+  }
+
+  /**
+   * Construct a pool. Use create instead, as the pool needs to be owned by
+   * a shared pointer.
+   *
+   * @param sim Simulation instance.
+   */
+  explicit CompactProcessPool(SimulationPtr sim) : CompactScheduler(sim) {}
+
+  /**
+   * Reserve queue space for a number of processes.
+   *
+   * @param capacity Number of processes.
+   */
+  void reserve(size_t capacity) { reserve_queue(capacity); }
+
+  /**
+   * Construct a process and run it immediately.
+   *
+   * @tparam Args Argument types of the constructor of T.
+   * @param args Arguments for the construction of T.
+   * @return Index of the process.
+   */
+  template <typename... Args> uint32_t start(Args &&...args) {
+    return start_delayed(0.0, std::forward<Args>(args)...);
+  }
+
+  /**
+   * Construct a process and run it after a delay.
+   *
+   * @tparam Args Argument types of the constructor of T.
+   * @param delay Delay after which to run the process.
+   * @param args Arguments for the construction of T.
+   * @return Index of the process.
+   */
+  template <typename... Args>
+  uint32_t start_delayed(simtime delay, Args &&...args) {
+    auto index = static_cast<uint32_t>(processes.size());
+    processes.emplace_back(std::forward<Args>(args)...);
+    ++running;
+    schedule(index, delay);
+    return index;
+  }
+
+  /**
+   * @param index Index of the process.
+   * @return Process at the index.
+   */
+  T &operator[](uint32_t index) { return processes[index]; }
+
+  /// @return Number of processes in the pool.
+  size_t size() { return processes.size(); }
+
+  /// @return Number of processes which have not finished yet.
+  size_t get_running_count() { return running; }
+
+protected:
+  bool resume(CompactContext &context) override {
+    return processes[context.get_index()].Run(context);
+  }
+
+private:
+  // A deque keeps references stable, so a running process may start new
+  // processes in the same pool.
+  std::deque<T> processes;
+};
+
+} // namespace simcpp
+
+#endif // SIMCPP_COMPACT_H_
@@ -0,0 +1,254 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#ifndef SIMCPP_ENSEMBLE_H_
+#define SIMCPP_ENSEMBLE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "compact.h"
+
+namespace simcpp {
+
+/**
+ * Replications of a small model of compact processes, run in lockstep.
+ *
+ * Every replication (lane) consists of the same number of processes of type
+ * T, all started at time 0 in the order of their index. Instead of one
+ * simulation per lane, all lanes share one kernel. The wake-up key
+ * (time, scheduling id) of every process is stored in structure-of-arrays
+ * form, with the lanes of one process index next to each other. In each
+ * round, the earliest key of every lane is selected with a vertical
+ * minimum over the process indices, four lanes at a time with AVX2 when
+ * compiled with -mavx2 and one lane at a time otherwise. Then every lane
+ * resumes its selected process, so each lane has its own clock and processes
+ * one event per round.
+ *
+ * Each round costs time linear in the number of processes per lane, so this
+ * is meant for small models, such as a single queue, with many lanes.
+ *
+ * Each lane resumes its processes in exactly the same order and at the same
+ * times as a CompactProcessPool holding the same processes, started in the
+ * same order, in an independent simulation.
+ *
+ * @tparam T Process class. Must be a subclass of CompactProcess.
+ */
+template <typename T> class CompactEnsemble {
+public:
+  /// Function which constructs a process of a lane.
+  using Setup = std::function<T(size_t lane, uint32_t process)>;
+
+  /**
+   * Construct the processes of all lanes.
+   *
+   * @param lanes Number of lanes.
+   * @param processes Number of processes per lane.
+   * @param setup Function called once per lane and process.
+   */
+  CompactEnsemble(size_t lanes, uint32_t processes, Setup setup)
+      : lanes(lanes), processes(processes),
+        times(lanes * processes, 0.0), ids(lanes * processes),
+        clocks(lanes, 0.0), next_ids(lanes, processes), steps(lanes, 0),
+        best_times(lanes), best_ids(lanes), best_processes(lanes) {
+    states.reserve(lanes * processes);
+    for (uint32_t process = 0; process < processes; ++process) {
+      for (size_t lane = 0; lane < lanes; ++lane) {
+        states.push_back(setup(lane, process));
+        ids[slot(lane, process)] = process;
+      }
+    }
+  }
+
+  /// @return Number of lanes.
+  size_t size() { return lanes; }
+
+  /// @return Number of processes per lane.
+  uint32_t get_process_count() { return processes; }
+
+  /**
+   * @param lane Index of the lane.
+   * @param process Index of the process in the lane.
+   * @return Process instance.
+   */
+  T &get_process(size_t lane, uint32_t process) {
+    return states[slot(lane, process)];
+  }
+
+  /**
+   * @param lane Index of the lane.
+   * @return Current simulation time of the lane.
+   */
+  simtime get_now(size_t lane) { return clocks[lane]; }
+
+  /**
+   * @param lane Index of the lane.
+   * @return Number of process resumptions in the lane so far.
+   */
+  size_t get_step_count(size_t lane) { return steps[lane]; }
+
+  /// @return Whether any process of any lane is waiting.
+  bool has_next() {
+    for (auto time : times) {
+      if (time != infinity()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Run all lanes until no process is waiting.
+  void run() { run_until(infinity()); }
+
+  /**
+   * Run all lanes until no process is waiting before a time.
+   *
+   * Afterwards, the clock of every lane which is behind the time is set to
+   * it, as with Simulation::advance_by. A NaN time does nothing.
+   *
+   * @param until Time up to which processes are resumed.
+   */
+  void run_until(simtime until) {
+    if (std::isnan(until)) {
+      return;
+    }
+
+    while (true) {
+      select();
+      if (resume_selected(until) == 0) {
+        break;
+      }
+    }
+
+    if (until != infinity()) {
+      for (auto &clock : clocks) {
+        clock = std::max(clock, until);
+      }
+    }
+  }
+
+private:
+  // Scheduling ids are signed, so that AVX2 can compare them.
+  static constexpr int64_t no_id = std::numeric_limits<int64_t>::max();
+
+  size_t lanes;
+  uint32_t processes;
+
+  // Per process and lane, at index process * lanes + lane. A process which is
+  // not waiting has time infinity and id no_id.
+  std::vector<T> states;
+  std::vector<simtime> times;
+  std::vector<int64_t> ids;
+
+  // Per lane.
+  std::vector<simtime> clocks;
+  std::vector<int64_t> next_ids;
+  std::vector<size_t> steps;
+  std::vector<simtime> best_times;
+  std::vector<int64_t> best_ids;
+  std::vector<int64_t> best_processes;
+
+  static simtime infinity() { return std::numeric_limits<simtime>::infinity(); }
+
+  size_t slot(size_t lane, uint32_t process) {
+    return static_cast<size_t>(process) * lanes + lane;
+  }
+
+  // Select the process with the earliest key in every lane, or -1 if no
+  // process of the lane is waiting.
+  void select() {
+    std::fill(best_times.begin(), best_times.end(), infinity());
+    std::fill(best_ids.begin(), best_ids.end(), no_id);
+    std::fill(best_processes.begin(), best_processes.end(), -1);
+
+    for (uint32_t process = 0; process < processes; ++process) {
+      const simtime *time = &times[slot(0, process)];
+      const int64_t *id = &ids[slot(0, process)];
+      size_t lane = 0;
+
+#ifdef __AVX2__
+      __m256i process_v = _mm256_set1_epi64x(process);
+      for (; lane + 4 <= lanes; lane += 4) {
+        __m256d time_v = _mm256_loadu_pd(time + lane);
+        __m256i id_v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(id + lane));
+        __m256d best_time_v = _mm256_loadu_pd(&best_times[lane]);
+        __m256i best_id_v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(&best_ids[lane]));
+        __m256i best_process_v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(&best_processes[lane]));
+
+        __m256i earlier = _mm256_castpd_si256(
+            _mm256_cmp_pd(time_v, best_time_v, _CMP_LT_OQ));
+        __m256i same_time = _mm256_castpd_si256(
+            _mm256_cmp_pd(time_v, best_time_v, _CMP_EQ_OQ));
+        __m256i smaller_id = _mm256_cmpgt_epi64(best_id_v, id_v);
+        __m256i better = _mm256_or_si256(
+            earlier, _mm256_and_si256(same_time, smaller_id));
+
+        _mm256_storeu_pd(&best_times[lane],
+                         _mm256_blendv_pd(best_time_v, time_v,
+                                          _mm256_castsi256_pd(better)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(&best_ids[lane]),
+                            _mm256_blendv_epi8(best_id_v, id_v, better));
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(&best_processes[lane]),
+            _mm256_blendv_epi8(best_process_v, process_v, better));
+      }
+#endif
+
+      for (; lane < lanes; ++lane) {
+        bool better = time[lane] < best_times[lane] ||
+                      (time[lane] == best_times[lane] &&
+                       id[lane] < best_ids[lane]);
+        if (better) {
+          best_times[lane] = time[lane];
+          best_ids[lane] = id[lane];
+          best_processes[lane] = process;
+        }
+      }
+    }
+  }
+
+  // Resume the selected process of every lane whose key is not after until.
+  // Returns the number of lanes which resumed a process.
+  size_t resume_selected(simtime until) {
+    size_t resumed = 0;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+      if (best_processes[lane] < 0 || best_times[lane] > until) {
+        continue;
+      }
+
+      auto process = static_cast<uint32_t>(best_processes[lane]);
+      size_t i = slot(lane, process);
+      clocks[lane] = best_times[lane];
+      ++steps[lane];
+      ++resumed;
+
+      CompactContext context(clocks[lane], process);
+      states[i].Run(context);
+      if (context.is_waiting()) {
+        times[i] = clocks[lane] + context.get_delay();
+        ids[i] = next_ids[lane]++;
+      } else {
+        times[i] = infinity();
+        ids[i] = no_id;
+      }
+    }
+    return resumed;
+  }
+};
+
+template <typename T> constexpr int64_t CompactEnsemble<T>::no_id;
+
+} // namespace simcpp
+
+#endif // SIMCPP_ENSEMBLE_H_
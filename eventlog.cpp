@@ -0,0 +1,268 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#include "eventlog.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace simcpp {
+
+namespace {
+
+// The header occupies exactly one record slot, so records never straddle the
+// boundary of a window whose size is a multiple of the record size.
+class LogHeader {
+public:
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t count;
+  uint64_t reserved;
+};
+
+static_assert(sizeof(StepRecord) == 32, "StepRecord must have no padding");
+static_assert(sizeof(LogHeader) == sizeof(StepRecord),
+              "LogHeader must fill one record slot");
+
+const char log_magic[8] = {'S', 'I', 'M', 'C', 'P', 'P', 'E', 'L'};
+const uint32_t log_version = 2;
+
+// Number of page-aligned record units mapped at once by the writer.
+const size_t window_units = 1024;
+
+void throw_errno(const std::string &what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+size_t gcd(size_t a, size_t b) {
+  while (b != 0) {
+    size_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+void write_header(int fd, uint64_t count) {
+  LogHeader header;
+  std::memcpy(header.magic, log_magic, sizeof(log_magic));
+  header.version = log_version;
+  header.record_size = sizeof(StepRecord);
+  header.count = count;
+  header.reserved = 0;
+  if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    throw_errno("cannot write event log header");
+  }
+}
+
+} // namespace
+
+/* EventLogWriter */
+
+EventLogWriter::EventLogWriter(const std::string &path) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw_errno("cannot create event log " + path);
+  }
+
+  // Smallest size which is both a multiple of the page size (required for
+  // the mmap offset) and of the record size.
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t unit = page / gcd(page, sizeof(StepRecord)) * sizeof(StepRecord);
+  window_size = unit * window_units;
+
+  write_header(fd, 0);
+  map_window(0);
+}
+
+EventLogWriter::~EventLogWriter() {
+  try {
+    close();
+  } catch (...) {
+  }
+}
+
+void EventLogWriter::append(const StepRecord &record) {
+  if (fd < 0) {
+    return;
+  }
+
+  size_t offset = (count + 1) * sizeof(StepRecord);
+  if (offset >= window_offset + window_size) {
+    map_window(offset);
+  }
+
+  std::memcpy(window + (offset - window_offset), &record, sizeof(record));
+  ++count;
+}
+
+void EventLogWriter::attach(SimulationPtr sim) {
+  sim->set_step_observer(
+      [this](const StepRecord &record) { this->append(record); });
+}
+
+void EventLogWriter::close() {
+  if (fd < 0) {
+    return;
+  }
+
+  munmap(window, window_size);
+  window = nullptr;
+
+  int fd = this->fd;
+  this->fd = -1;
+  size_t length = (count + 1) * sizeof(StepRecord);
+  if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+    ::close(fd);
+    throw_errno("cannot truncate event log");
+  }
+  write_header(fd, count);
+  ::close(fd);
+}
+
+size_t EventLogWriter::size() { return count; }
+
+void EventLogWriter::map_window(size_t offset) {
+  if (window != nullptr) {
+    munmap(window, window_size);
+    window = nullptr;
+    // Publish the records of the finished window, so a log of a crashed run
+    // can be read up to here.
+    write_header(fd, count);
+  }
+
+  if (ftruncate(fd, static_cast<off_t>(offset + window_size)) != 0) {
+    throw_errno("cannot extend event log");
+  }
+
+  void *mapped = mmap(nullptr, window_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, static_cast<off_t>(offset));
+  if (mapped == MAP_FAILED) {
+    throw_errno("cannot map event log");
+  }
+
+  window = static_cast<char *>(mapped);
+  window_offset = offset;
+}
+
+/* EventLogReader */
+
+EventLogReader::EventLogReader(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw_errno("cannot open event log " + path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw_errno("cannot stat event log " + path);
+  }
+  length = static_cast<size_t>(st.st_size);
+  if (length < sizeof(LogHeader)) {
+    ::close(fd);
+    throw std::runtime_error("not an event log: " + path);
+  }
+
+  void *mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    throw_errno("cannot map event log " + path);
+  }
+  data = static_cast<char *>(mapped);
+  madvise(data, length, MADV_SEQUENTIAL);
+
+  LogHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  size_t capacity = length / sizeof(StepRecord) - 1;
+  if (std::memcmp(header.magic, log_magic, sizeof(log_magic)) != 0 ||
+      header.version != log_version ||
+      header.record_size != sizeof(StepRecord) || header.count > capacity) {
+    munmap(data, length);
+    data = nullptr;
+    throw std::runtime_error("not an event log: " + path);
+  }
+  count = static_cast<size_t>(header.count);
+}
+
+EventLogReader::~EventLogReader() {
+  if (data != nullptr) {
+    munmap(data, length);
+  }
+}
+
+size_t EventLogReader::size() { return count; }
+
+const StepRecord &EventLogReader::operator[](size_t index) {
+  return begin()[index];
+}
+
+const StepRecord *EventLogReader::begin() {
+  return reinterpret_cast<const StepRecord *>(data + sizeof(LogHeader));
+}
+
+const StepRecord *EventLogReader::end() { return begin() + count; }
+
+/* ReplayVerifier */
+
+ReplayVerifier::ReplayVerifier(const std::string &path) : reader(path) {}
+
+void ReplayVerifier::check(const StepRecord &record) {
+  if (diverged) {
+    return;
+  }
+
+  if (checked >= reader.size()) {
+    diverged = true;
+    divergence.index = checked;
+    divergence.has_actual = true;
+    divergence.actual = record;
+  } else if (reader[checked] != record) {
+    diverged = true;
+    divergence.index = checked;
+    divergence.has_expected = true;
+    divergence.expected = reader[checked];
+    divergence.has_actual = true;
+    divergence.actual = record;
+  }
+
+  ++checked;
+}
+
+void ReplayVerifier::finish() {
+  if (diverged || checked >= reader.size()) {
+    return;
+  }
+
+  diverged = true;
+  divergence.index = checked;
+  divergence.has_expected = true;
+  divergence.expected = reader[checked];
+}
+
+bool ReplayVerifier::replay(SimulationPtr sim) {
+  sim->set_step_observer(
+      [this](const StepRecord &record) { this->check(record); });
+  while (!diverged && sim->step()) {
+  }
+  sim->set_step_observer(nullptr);
+
+  finish();
+  return !diverged;
+}
+
+bool ReplayVerifier::has_diverged() { return diverged; }
+
+Divergence ReplayVerifier::get_divergence() { return divergence; }
+
+size_t ReplayVerifier::get_checked_count() { return checked; }
+
+} // namespace simcpp
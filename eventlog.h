@@ -0,0 +1,194 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#ifndef SIMCPP_EVENTLOG_H_
+#define SIMCPP_EVENTLOG_H_
+
+#include <string>
+
+#include "simcpp.h"
+
+namespace simcpp {
+
+/**
+ * Append-only binary log of the records produced by Simulation::step.
+ *
+ * The file consists of a header slot followed by one fixed-size StepRecord per
+ * processed queue entry. It is written through a memory-mapped window which
+ * is moved forward as the file grows, so the memory use does not depend on the
+ * length of the log. The record count in the header is updated whenever the
+ * window moves and when the log is closed.
+ */
+class EventLogWriter {
+public:
+  /**
+   * Create or truncate a log file.
+   *
+   * Throws std::system_error if the file cannot be created.
+   *
+   * @param path Path of the log file.
+   */
+  explicit EventLogWriter(const std::string &path);
+
+  EventLogWriter(const EventLogWriter &) = delete;
+  EventLogWriter &operator=(const EventLogWriter &) = delete;
+
+  /// Close the log file.
+  ~EventLogWriter();
+
+  /**
+   * Append a record to the log.
+   *
+   * @param record Record to append.
+   */
+  void append(const StepRecord &record);
+
+  /**
+   * Record all entries processed by a simulation in this log.
+   *
+   * The writer must outlive the simulation or be detached by calling
+   * sim->set_step_observer(nullptr).
+   *
+   * @param sim Simulation instance.
+   */
+  void attach(SimulationPtr sim);
+
+  /**
+   * Finish the log and close the file.
+   *
+   * The file is truncated to its final length and the number of records is
+   * written to the header. Further calls to append are ignored.
+   */
+  void close();
+
+  /// @return Number of records appended so far.
+  size_t size();
+
+private:
+  int fd = -1;
+  char *window = nullptr;
+  size_t window_offset = 0;
+  size_t window_size = 0;
+  size_t count = 0;
+
+  void map_window(size_t offset);
+};
+
+/// Read-only memory-mapped view of a log written by EventLogWriter.
+class EventLogReader {
+public:
+  /**
+   * Open a log file.
+   *
+   * Throws std::system_error if the file cannot be opened and
+   * std::runtime_error if it is not a valid log.
+   *
+   * @param path Path of the log file.
+   */
+  explicit EventLogReader(const std::string &path);
+
+  EventLogReader(const EventLogReader &) = delete;
+  EventLogReader &operator=(const EventLogReader &) = delete;
+
+  /// Close the log file.
+  ~EventLogReader();
+
+  /**
+   * @return Number of records in the log. If the writer was not closed
+   * properly, the header count is only as recent as the last time the writer
+   * moved its window, so records appended after that are not visible. They
+   * cannot be recovered, as the rest of the file is zero-padded up to the end
+   * of the window and records carry no validity marker.
+   */
+  size_t size();
+
+  /**
+   * @param index Index of the record. Must be less than size().
+   * @return Record at the given index.
+   */
+  const StepRecord &operator[](size_t index);
+
+  /// @return Pointer to the first record.
+  const StepRecord *begin();
+
+  /// @return Pointer past the last record.
+  const StepRecord *end();
+
+private:
+  char *data = nullptr;
+  size_t length = 0;
+  size_t count = 0;
+};
+
+/// First difference between a log and a replayed simulation.
+class Divergence {
+public:
+  /// Index of the first record that differs.
+  size_t index = 0;
+  /// Whether the log contains a record at the index.
+  bool has_expected = false;
+  /// Record in the log, if any.
+  StepRecord expected = {};
+  /// Whether the replay produced a record at the index.
+  bool has_actual = false;
+  /// Record produced by the replay, if any.
+  StepRecord actual = {};
+};
+
+/// Checks that a simulation processes the same entries as a recorded log.
+class ReplayVerifier {
+public:
+  /**
+   * Open the log to verify against.
+   *
+   * @param path Path of the log file.
+   */
+  explicit ReplayVerifier(const std::string &path);
+
+  /**
+   * Compare the next record of the replay with the log.
+   *
+   * Records after the first divergence are ignored.
+   *
+   * @param record Record produced by the replay.
+   */
+  void check(const StepRecord &record);
+
+  /**
+   * Mark the replay as finished.
+   *
+   * If the log contains more records than were checked, this is reported as a
+   * divergence.
+   */
+  void finish();
+
+  /**
+   * Run a freshly set up simulation and compare it with the log.
+   *
+   * The simulation is stepped until it runs out of events or diverges from the
+   * log. Afterwards, finish is called.
+   *
+   * @param sim Simulation instance, set up like the recorded simulation.
+   * @return Whether the simulation matched the log.
+   */
+  bool replay(SimulationPtr sim);
+
+  /// @return Whether a divergence was found.
+  bool has_diverged();
+
+  /// @return First divergence. Only meaningful if has_diverged().
+  Divergence get_divergence();
+
+  /// @return Number of records checked so far.
+  size_t get_checked_count();
+
+private:
+  EventLogReader reader;
+  size_t checked = 0;
+  bool diverged = false;
+  Divergence divergence;
+};
+
+} // namespace simcpp
+
+#endif // SIMCPP_EVENTLOG_H_
@@ -0,0 +1,46 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#include <cstdio>
+
+#include "hybrid.h"
+#include "simcpp.h"
+
+class Pump : public simcpp::Process {
+public:
+  explicit Pump(simcpp::SimulationPtr sim, simcpp::ContinuousStatePtr state,
+                size_t tank)
+      : Process(sim), state(state), tank(tank) {}
+
+  bool Run() override {
+    auto sim = this->sim.lock();
+
+    PT_BEGIN();
+
+    while (sim->get_now() < 100.0) {
+      printf("Filling tank at %g.\n", sim->get_now());
+      state->set_rate(tank, 2.0);
+      PROC_WAIT_FOR(state->crossing(tank, 40.0));
+
+      printf("Draining tank at %g.\n", sim->get_now());
+      state->set_rate(tank, -0.5);
+      PROC_WAIT_FOR(state->crossing(tank, 10.0));
+    }
+
+    PT_END();
+  }
+
+private:
+  simcpp::ContinuousStatePtr state;
+  size_t tank;
+};
+
+int main() {
+  auto sim = simcpp::Simulation::create();
+  auto state = simcpp::ContinuousState::create(sim);
+  size_t tank = state->add_variable(10.0);
+  sim->start_process<Pump>(state, tank);
+  sim->run();
+
+  return 0;
+}
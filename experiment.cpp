@@ -0,0 +1,280 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#include "experiment.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace simcpp {
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+double mean_of(const std::vector<double> &values, size_t first) {
+  double sum = 0.0;
+  for (size_t i = first; i < values.size(); ++i) {
+    sum += values[i];
+  }
+  return sum / static_cast<double>(values.size() - first);
+}
+
+// Mean of a series after deleting its MSER-5 warm-up period.
+double truncated_mean(const std::vector<double> &series, size_t *warmup) {
+  *warmup = mser5_truncation(series);
+  return mean_of(series, *warmup);
+}
+
+bool is_precise(double mean, double half_width, double relative_precision) {
+  return half_width <= relative_precision * std::fabs(mean);
+}
+
+// Quantile of the standard normal distribution, by Newton's method on the
+// distribution function.
+double normal_quantile(double p) {
+  double z = 0.0;
+  for (int i = 0; i < 50; ++i) {
+    double cdf = 0.5 * std::erfc(-z / std::sqrt(2.0));
+    double pdf = std::exp(-0.5 * z * z) / std::sqrt(2.0 * pi);
+    double step = (cdf - p) / pdf;
+    z -= step;
+    if (std::fabs(step) < 1e-12) {
+      break;
+    }
+  }
+  return z;
+}
+
+// Probability that |T| < t for a Student t variable T with an integer number
+// of degrees of freedom, in closed form (Abramowitz and Stegun 26.7.3 and
+// 26.7.4), written in terms of theta = atan(t / sqrt(dof)).
+double student_t_central(double theta, size_t dof) {
+  double s = std::sin(theta);
+  double c = std::cos(theta);
+  double c2 = c * c;
+
+  double sum = 1.0;
+  double term = 1.0;
+  if (dof % 2 == 1) {
+    if (dof == 1) {
+      return 2.0 * theta / pi;
+    }
+    for (size_t k = 3; k + 2 <= dof; k += 2) {
+      term *= c2 * static_cast<double>(k - 1) / static_cast<double>(k);
+      sum += term;
+    }
+    return 2.0 / pi * (theta + s * c * sum);
+  }
+
+  for (size_t k = 2; k + 2 <= dof; k += 2) {
+    term *= c2 * static_cast<double>(k - 1) / static_cast<double>(k);
+    sum += term;
+  }
+  return s * sum;
+}
+
+// Quantile of the Student t distribution. Up to 30 degrees of freedom, the
+// closed-form distribution function is inverted by bisection. Above, the
+// Cornish-Fisher expansion around the normal quantile (Abramowitz and Stegun
+// 26.7.5) is accurate to well below 0.1%.
+double student_t_quantile(double p, size_t dof) {
+  if (dof <= 30) {
+    double central = 2.0 * p - 1.0;
+    double sign = central < 0.0 ? -1.0 : 1.0;
+    central = std::fabs(central);
+
+    double low = 0.0;
+    double high = pi / 2.0;
+    for (int i = 0; i < 100; ++i) {
+      double mid = 0.5 * (low + high);
+      if (student_t_central(mid, dof) < central) {
+        low = mid;
+      } else {
+        high = mid;
+      }
+    }
+    double theta = 0.5 * (low + high);
+    return sign * std::tan(theta) * std::sqrt(static_cast<double>(dof));
+  }
+
+  double z = normal_quantile(p);
+  double v = static_cast<double>(dof);
+  double z2 = z * z;
+  double g1 = (z2 + 1.0) * z / 4.0;
+  double g2 = ((5.0 * z2 + 16.0) * z2 + 3.0) * z / 96.0;
+  double g3 = (((3.0 * z2 + 19.0) * z2 + 17.0) * z2 - 15.0) * z / 384.0;
+  double g4 =
+      ((((79.0 * z2 + 776.0) * z2 + 1482.0) * z2 - 1920.0) * z2 - 945.0) * z /
+      92160.0;
+  return z + g1 / v + g2 / (v * v) + g3 / (v * v * v) + g4 / (v * v * v * v);
+}
+
+} // namespace
+
+/* Experiment */
+
+Experiment::Experiment(Model model, ExperimentSettings settings)
+    : model(model), settings(settings) {}
+
+ExperimentResult Experiment::replicate() {
+  ExperimentResult result;
+  result.run_length = settings.horizon;
+
+  std::vector<double> means;
+  size_t warmup_total = 0;
+  for (size_t replication = 0; replication < settings.max_replications;
+       ++replication) {
+    result.replications = replication + 1;
+
+    auto sim = Simulation::create();
+    std::vector<double> series;
+    model(sim, series, replication);
+    sim->advance_by(settings.horizon);
+    result.events += sim->get_step_count();
+
+    if (series.empty()) {
+      continue;
+    }
+    size_t warmup;
+    means.push_back(truncated_mean(series, &warmup));
+    warmup_total += warmup;
+
+    if (means.size() >= std::max<size_t>(settings.min_replications, 2)) {
+      result.mean = mean_of(means, 0);
+      result.half_width = confidence_half_width(means, settings.confidence);
+      if (is_precise(result.mean, result.half_width,
+                     settings.relative_precision)) {
+        result.converged = true;
+        break;
+      }
+    }
+  }
+
+  if (!means.empty()) {
+    result.warmup = warmup_total / means.size();
+  }
+  if (result.replications > 0) {
+    result.budget_events = result.events / result.replications *
+                           settings.max_replications;
+  }
+  if (result.budget_events > result.events) {
+    result.saved_events = result.budget_events - result.events;
+  }
+  return result;
+}
+
+ExperimentResult Experiment::batch_means() {
+  ExperimentResult result;
+  result.replications = 1;
+
+  auto sim = Simulation::create();
+  std::vector<double> series;
+  model(sim, series, 0);
+
+  size_t batches = std::max<size_t>(settings.batches, 2);
+  simtime length = std::min(settings.horizon, settings.max_horizon);
+  while (true) {
+    sim->advance_by(length - sim->get_now());
+    result.run_length = length;
+
+    size_t warmup = mser5_truncation(series);
+    size_t batch_size = (series.size() - warmup) / batches;
+    if (batch_size > 0) {
+      // Any remainder is deleted from the start, next to the warm-up.
+      size_t first = series.size() - batch_size * batches;
+      std::vector<double> batch_means(batches, 0.0);
+      for (size_t i = first; i < series.size(); ++i) {
+        batch_means[(i - first) / batch_size] += series[i];
+      }
+      for (auto &batch_mean : batch_means) {
+        batch_mean /= static_cast<double>(batch_size);
+      }
+
+      result.warmup = warmup;
+      result.mean = mean_of(batch_means, 0);
+      result.half_width =
+          confidence_half_width(batch_means, settings.confidence);
+      if (is_precise(result.mean, result.half_width,
+                     settings.relative_precision)) {
+        result.converged = true;
+        break;
+      }
+    }
+
+    if (length >= settings.max_horizon) {
+      break;
+    }
+    length = std::min(2.0 * length, settings.max_horizon);
+  }
+
+  result.events = sim->get_step_count();
+  if (result.run_length > 0.0) {
+    result.budget_events = static_cast<size_t>(
+        static_cast<double>(result.events) / result.run_length *
+        settings.max_horizon);
+  }
+  if (result.budget_events > result.events) {
+    result.saved_events = result.budget_events - result.events;
+  }
+  return result;
+}
+
+/* Output analysis */
+
+size_t mser5_truncation(const std::vector<double> &series) {
+  const size_t batch_size = 5;
+  size_t batches = series.size() / batch_size;
+  if (batches < 2) {
+    return 0;
+  }
+
+  std::vector<double> means(batches, 0.0);
+  for (size_t i = 0; i < batches * batch_size; ++i) {
+    means[i / batch_size] += series[i] / batch_size;
+  }
+
+  // Walk backwards, keeping the sums of the batch means after d, and evaluate
+  // the MSER statistic for every d in the first half.
+  double sum = 0.0;
+  double sum_squares = 0.0;
+  size_t best = 0;
+  double best_statistic = 0.0;
+  for (size_t d = batches; d-- > 0;) {
+    sum += means[d];
+    sum_squares += means[d] * means[d];
+    if (d > batches / 2) {
+      continue;
+    }
+
+    double k = static_cast<double>(batches - d);
+    double deviation = std::max(sum_squares - sum * sum / k, 0.0);
+    double statistic = deviation / (k * k);
+    if (d == batches / 2 || statistic <= best_statistic) {
+      best = d;
+      best_statistic = statistic;
+    }
+  }
+
+  return best * batch_size;
+}
+
+double confidence_half_width(const std::vector<double> &samples,
+                             double confidence) {
+  size_t n = samples.size();
+  if (n < 2) {
+    return 0.0;
+  }
+
+  double mean = mean_of(samples, 0);
+  double squares = 0.0;
+  for (double sample : samples) {
+    squares += (sample - mean) * (sample - mean);
+  }
+  double variance = squares / static_cast<double>(n - 1);
+
+  double t = student_t_quantile(0.5 + confidence / 2.0, n - 1);
+  return t * std::sqrt(variance / static_cast<double>(n));
+}
+
+} // namespace simcpp
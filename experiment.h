@@ -0,0 +1,154 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#ifndef SIMCPP_EXPERIMENT_H_
+#define SIMCPP_EXPERIMENT_H_
+
+#include <functional>
+#include <vector>
+
+#include "simcpp.h"
+
+namespace simcpp {
+
+/// Settings of an Experiment.
+class ExperimentSettings {
+public:
+  /// Target ratio of the confidence interval half-width to the mean.
+  double relative_precision = 0.05;
+
+  /// Confidence level of the confidence interval.
+  double confidence = 0.95;
+
+  /// Simulated duration of each replication, and of the first part of the
+  /// single run used for batch means.
+  simtime horizon = 1000.0;
+
+  /// Minimum number of replications before checking the precision.
+  size_t min_replications = 5;
+
+  /// Maximum number of replications (the fixed budget).
+  size_t max_replications = 100;
+
+  /// Number of batches used for batch means.
+  size_t batches = 20;
+
+  /// Maximum simulated duration of the batch means run (the fixed budget).
+  simtime max_horizon = 100000.0;
+};
+
+/// Result of an Experiment.
+class ExperimentResult {
+public:
+  /// Estimated mean of the output.
+  double mean = 0.0;
+
+  /// Half-width of the confidence interval around the mean.
+  double half_width = 0.0;
+
+  /// Whether the requested relative precision was reached.
+  bool converged = false;
+
+  /// Number of replications run (1 for batch means).
+  size_t replications = 0;
+
+  /// Simulated duration of the batch means run, or of each replication.
+  simtime run_length = 0.0;
+
+  /// Number of observations deleted as warm-up, averaged over replications.
+  size_t warmup = 0;
+
+  /// Number of events processed.
+  size_t events = 0;
+
+  /**
+   * Number of events the fixed budget (max_replications or max_horizon)
+   * would have needed, estimated from the observed events per replication or
+   * per time unit.
+   */
+  size_t budget_events = 0;
+
+  /// Number of events saved compared with the fixed budget.
+  size_t saved_events = 0;
+};
+
+/**
+ * Controller which runs a model until the confidence interval of its output
+ * is precise enough.
+ *
+ * The model appends observations of the output to the series it receives
+ * while it runs. The warm-up period of each series is removed with the
+ * MSER-5 rule before estimating the mean.
+ */
+class Experiment {
+public:
+  /**
+   * Function which sets up a simulation of the model.
+   *
+   * The series stays valid while the simulation runs. The replication index
+   * can be used to seed random number generators.
+   */
+  using Model = std::function<void(SimulationPtr sim,
+                                   std::vector<double> &series,
+                                   size_t replication)>;
+
+  /**
+   * Construct an experiment.
+   *
+   * @param model Function which sets up a simulation of the model.
+   * @param settings Settings of the experiment.
+   */
+  Experiment(Model model, ExperimentSettings settings);
+
+  /**
+   * Estimate the mean with the replication/deletion method.
+   *
+   * Replications of length horizon are run until the confidence interval
+   * over the replication means reaches the relative precision or
+   * max_replications replications were run.
+   *
+   * @return Result of the experiment.
+   */
+  ExperimentResult replicate();
+
+  /**
+   * Estimate the mean with the batch means method.
+   *
+   * A single run is extended, doubling its length starting from horizon,
+   * until the confidence interval over the batch means reaches the relative
+   * precision or the run reaches max_horizon.
+   *
+   * @return Result of the experiment.
+   */
+  ExperimentResult batch_means();
+
+private:
+  Model model;
+  ExperimentSettings settings;
+};
+
+/**
+ * Find the warm-up period of a series with the MSER-5 rule.
+ *
+ * The series is divided into batches of five observations, and the number of
+ * leading batches which minimizes the marginal standard error of the
+ * remaining batch means is deleted. At most half of the batches are deleted.
+ *
+ * @param series Observations.
+ * @return Number of observations to delete from the start of the series.
+ */
+size_t mser5_truncation(const std::vector<double> &series);
+
+/**
+ * Compute the half-width of a Student t confidence interval for the mean.
+ *
+ * @param samples Independent samples. At least two are required.
+ * @param confidence Confidence level.
+ * @return Half-width of the confidence interval.
+ */
+double confidence_half_width(const std::vector<double> &samples,
+                             double confidence);
+
+} // namespace simcpp
+
+#endif // SIMCPP_EXPERIMENT_H_
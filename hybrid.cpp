@@ -0,0 +1,142 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#include "hybrid.h"
+
+namespace simcpp {
+
+ContinuousStatePtr ContinuousState::create(SimulationPtr sim) {
+  return std::make_shared<ContinuousState>(sim);
+}
+
+ContinuousState::ContinuousState(SimulationPtr sim)
+    : sim(sim), synced_at(sim->get_now()) {}
+
+size_t ContinuousState::add_variable(double value, double rate /* = 0.0 */) {
+  sync();
+  values.push_back(value);
+  rates.push_back(rate);
+  watches.emplace_back();
+  return values.size() - 1;
+}
+
+size_t ContinuousState::size() { return values.size(); }
+
+double ContinuousState::get_value(size_t variable) {
+  auto sim = this->sim.lock();
+  return values[variable] + rates[variable] * (sim->get_now() - synced_at);
+}
+
+double ContinuousState::get_rate(size_t variable) { return rates[variable]; }
+
+void ContinuousState::set_value(size_t variable, double value) {
+  sync();
+  values[variable] = value;
+  schedule_watches(variable);
+}
+
+void ContinuousState::set_rate(size_t variable, double rate) {
+  sync();
+  rates[variable] = rate;
+  schedule_watches(variable);
+}
+
+EventPtr ContinuousState::crossing(size_t variable, double level) {
+  auto sim = this->sim.lock();
+
+  Watch watch;
+  watch.level = level;
+  watch.target = sim->event();
+  schedule_watch(variable, watch);
+  watches[variable].push_back(watch);
+  return watch.target;
+}
+
+void ContinuousState::sync() {
+  auto sim = this->sim.lock();
+  simtime now = sim->get_now();
+  if (now == synced_at) {
+    return;
+  }
+
+  // Plain loop over contiguous arrays, which the compiler vectorizes.
+  double dt = now - synced_at;
+  double *value = values.data();
+  const double *rate = rates.data();
+  size_t n = values.size();
+  for (size_t i = 0; i < n; ++i) {
+    value[i] += rate[i] * dt;
+  }
+  synced_at = now;
+}
+
+void ContinuousState::schedule_watches(size_t variable) {
+  auto &list = watches[variable];
+
+  // Drop watches whose event was aborted or triggered in the meantime.
+  size_t kept = 0;
+  for (size_t i = 0; i < list.size(); ++i) {
+    if (list[i].target->is_pending()) {
+      list[kept++] = list[i];
+    } else if (list[i].timer) {
+      list[i].timer->abort();
+    }
+  }
+  list.resize(kept);
+
+  for (auto &watch : list) {
+    schedule_watch(variable, watch);
+  }
+}
+
+void ContinuousState::schedule_watch(size_t variable, Watch &watch) {
+  // A timer with delay 0 is already triggered and can no longer be aborted,
+  // so fire also checks that the timer is still the current one.
+  if (watch.timer) {
+    watch.timer->abort();
+    watch.timer.reset();
+  }
+
+  double value = get_value(variable);
+  double rate = rates[variable];
+  simtime delay;
+  if (value == watch.level) {
+    delay = 0.0;
+  } else if (rate == 0.0) {
+    return;
+  } else {
+    delay = (watch.level - value) / rate;
+    if (delay < 0.0) {
+      return;
+    }
+  }
+
+  auto sim = this->sim.lock();
+  std::weak_ptr<ContinuousState> self = shared_from_this();
+  auto target = watch.target;
+  watch.timer = sim->event();
+  watch.timer->add_handler([self, variable, target](EventPtr timer) {
+    auto state = self.lock();
+    if (state) {
+      state->fire(variable, target, timer);
+    }
+  });
+  watch.timer->trigger(delay);
+}
+
+void ContinuousState::fire(size_t variable, EventPtr target, EventPtr timer) {
+  auto &list = watches[variable];
+  for (size_t i = 0; i < list.size(); ++i) {
+    if (list[i].target == target) {
+      if (list[i].timer != timer) {
+        // The watch was rescheduled after this timer was started.
+        return;
+      }
+      list.erase(list.begin() + static_cast<std::ptrdiff_t>(i));
+      target->trigger();
+      return;
+    }
+  }
+}
+
+} // namespace simcpp
@@ -0,0 +1,132 @@
+// Copyright © 2021 Bjørnar Steinnes Luteberget, Felix Schütz.
+// Licensed under the MIT license. See the LICENSE file for details.
+
+#ifndef SIMCPP_HYBRID_H_
+#define SIMCPP_HYBRID_H_
+
+#include <memory>
+#include <vector>
+
+#include "simcpp.h"
+
+namespace simcpp {
+
+class ContinuousState;
+using ContinuousStatePtr = std::shared_ptr<ContinuousState>;
+
+/**
+ * Continuous variables which evolve between the events of a simulation.
+ *
+ * Each variable has a value and a rate of change. The rate is constant
+ * between events and is changed by processes with set_rate, which makes the
+ * value piecewise linear in time. Instead of polling the variables with short
+ * timeouts, processes wait for a variable to cross a level. The crossing time
+ * is computed exactly and rescheduled whenever the rate or value of the
+ * variable changes.
+ *
+ * Values and rates are stored in contiguous arrays and integrated together
+ * in one sweep, at most once per simulation time at which a variable is
+ * changed.
+ */
+class ContinuousState : public std::enable_shared_from_this<ContinuousState> {
+public:
+  /**
+   * Create a set of continuous variables.
+   *
+   * @param sim Simulation instance.
+   * @return ContinuousState instance.
+   */
+  static ContinuousStatePtr create(SimulationPtr sim);
+
+  /**
+   * Construct a set of continuous variables. Use create instead, as crossing
+   * events need a shared pointer to the instance.
+   *
+   * @param sim Simulation instance.
+   */
+  explicit ContinuousState(SimulationPtr sim);
+
+  /**
+   * Add a variable.
+   *
+   * @param value Initial value.
+   * @param rate Initial rate of change per time unit.
+   * @return Index of the variable.
+   */
+  size_t add_variable(double value, double rate = 0.0);
+
+  /// @return Number of variables.
+  size_t size();
+
+  /**
+   * @param variable Index of the variable.
+   * @return Value of the variable at the current simulation time.
+   */
+  double get_value(size_t variable);
+
+  /**
+   * @param variable Index of the variable.
+   * @return Rate of change of the variable.
+   */
+  double get_rate(size_t variable);
+
+  /**
+   * Set the value of a variable at the current simulation time.
+   *
+   * @param variable Index of the variable.
+   * @param value New value.
+   */
+  void set_value(size_t variable, double value);
+
+  /**
+   * Set the rate of change of a variable from the current simulation time on.
+   *
+   * @param variable Index of the variable.
+   * @param rate New rate of change per time unit.
+   */
+  void set_rate(size_t variable, double rate);
+
+  /**
+   * Create an event which is triggered when a variable crosses a level.
+   *
+   * If the variable is at the level, the crossing is scheduled with delay 0,
+   * so the event is triggered after the entries already scheduled for the
+   * current time. It is not triggered if the variable leaves the level before
+   * then. If the variable does not move towards the level, the event stays
+   * pending until the rate or value of the variable is changed so that it
+   * does.
+   *
+   * @param variable Index of the variable.
+   * @param level Level to wait for.
+   * @return Event instance.
+   */
+  EventPtr crossing(size_t variable, double level);
+
+  /// Integrate all variables up to the current simulation time.
+  void sync();
+
+private:
+  class Watch {
+  public:
+    double level;
+    EventPtr target;
+    EventPtr timer;
+  };
+
+  SimulationWeakPtr sim;
+  simtime synced_at;
+  std::vector<double> values;
+  std::vector<double> rates;
+  std::vector<std::vector<Watch>> watches;
+
+  void schedule_watches(size_t variable);
+
+  void schedule_watch(size_t variable, Watch &watch);
+
+  // Trigger the target of a watch, unless the timer is stale.
+  void fire(size_t variable, EventPtr target, EventPtr timer);
+};
+
+} // namespace simcpp
+
+#endif // SIMCPP_HYBRID_H_
@@ -9,6 +9,14 @@ namespace simcpp {
 
 SimulationPtr Simulation::create() { return std::make_shared<Simulation>(); }
 
+SimulationPtr Simulation::create_sub_simulation() {
+  auto sub = create();
+  sub->has_parent = true;
+  sub->parent = shared_from_this();
+  sub->now = now;
+  return sub;
+}
+
 void Simulation::run_process(ProcessPtr process, simtime delay /* = 0.0 */) {
   auto event = this->event();
   event->add_handler(process);
@@ -53,28 +61,142 @@ EventPtr Simulation::all_of(std::initializer_list<EventPtr> events) {
 }
 
 void Simulation::schedule(EventPtr event, simtime delay /* = 0.0 */) {
-  queued_events.emplace(now + delay, next_id, event);
+  push(delay, std::move(event), EntryKind::Event);
+}
+
+void Simulation::schedule_resume(ProcessPtr process, simtime delay) {
+  push(delay, std::move(process), EntryKind::Resume);
+}
+
+void Simulation::push(simtime delay, EventPtr event, EntryKind kind) {
+  if (has_parent) {
+    sync_clock();
+  }
+
+  queued_events.emplace_back(now + delay, next_id, std::move(event), kind);
+  if (scheduled_activations == 0) {
+    sift_up<false>(queued_events.size() - 1);
+  } else {
+    sift_up<true>(queued_events.size() - 1);
+  }
   ++next_id;
+
+  if (has_parent) {
+    schedule_activation();
+  }
+}
+
+template <bool Track> Simulation::QueuedEvent Simulation::pop() {
+  QueuedEvent queued_event = std::move(queued_events.front());
+  QueuedEvent last = std::move(queued_events.back());
+  queued_events.pop_back();
+
+  if (!queued_events.empty()) {
+    // Like std::pop_heap, move the hole at the root down to a leaf along the
+    // earlier children, then sift the last entry up from there. The last entry
+    // usually belongs near the bottom, so this saves comparisons.
+    size_t size = queued_events.size();
+    size_t hole = 0;
+    while (true) {
+      size_t child = 2 * hole + 1;
+      if (child >= size) {
+        break;
+      }
+      if (child + 1 < size && queued_events[child] < queued_events[child + 1]) {
+        ++child;
+      }
+      place<Track>(hole, std::move(queued_events[child]));
+      hole = child;
+    }
+    queued_events[hole] = std::move(last);
+    sift_up<Track>(hole);
+  }
+
+  if (Track && queued_event.kind == EntryKind::Activation) {
+    static_cast<Activation *>(queued_event.event.get())->position =
+        Activation::not_scheduled;
+    --scheduled_activations;
+  }
+  return queued_event;
+}
+
+template <bool Track>
+void Simulation::place(size_t position, QueuedEvent &&queued_event) {
+  if (Track && queued_event.kind == EntryKind::Activation) {
+    static_cast<Activation *>(queued_event.event.get())->position = position;
+  }
+  queued_events[position] = std::move(queued_event);
+}
+
+template <bool Track> void Simulation::sift_up(size_t position) {
+  QueuedEvent queued_event = std::move(queued_events[position]);
+  while (position > 0) {
+    size_t parent = (position - 1) / 2;
+    if (!(queued_events[parent] < queued_event)) {
+      break;
+    }
+    place<Track>(position, std::move(queued_events[parent]));
+    position = parent;
+  }
+  place<Track>(position, std::move(queued_event));
 }
 
+template <bool Track> void Simulation::sift_down(size_t position) {
+  size_t size = queued_events.size();
+  QueuedEvent queued_event = std::move(queued_events[position]);
+  while (true) {
+    size_t child = 2 * position + 1;
+    if (child >= size) {
+      break;
+    }
+    if (child + 1 < size && queued_events[child] < queued_events[child + 1]) {
+      ++child;
+    }
+    if (!(queued_event < queued_events[child])) {
+      break;
+    }
+    place<Track>(position, std::move(queued_events[child]));
+    position = child;
+  }
+  place<Track>(position, std::move(queued_event));
+}
+
+void Simulation::reserve(size_t capacity) { queued_events.reserve(capacity); }
+
 bool Simulation::step() {
   if (queued_events.empty()) {
     return false;
   }
 
-  auto queued_event = queued_events.top();
-  queued_events.pop();
+  auto queued_event =
+      scheduled_activations == 0 ? pop<false>() : pop<true>();
   now = queued_event.time;
-  auto event = queued_event.event;
-  event->process();
+  ++step_count;
+  if (step_observer) {
+    step_observer(make_record(queued_event));
+  }
+  auto &event = queued_event.event;
+  switch (queued_event.kind) {
+  case EntryKind::Event:
+    event->process();
+    break;
+  case EntryKind::Resume:
+    static_cast<Process *>(event.get())->resume();
+    break;
+  case EntryKind::Activation:
+    static_cast<Activation *>(event.get())->activate(queued_event.time);
+    break;
+  }
   return true;
 }
 
 void Simulation::advance_by(simtime duration) {
   simtime target = now + duration;
-  while (has_next() && peek_next_time() <= target) {
-    step();
-  }
+  StopPolicy policy;
+  policy.until = target;
+  run(policy);
+  // run treats an infinite horizon as unset, but advance_by always ends at the
+  // target.
   now = target;
 }
 
@@ -91,16 +213,200 @@ void Simulation::run() {
   }
 }
 
-simtime Simulation::get_now() { return now; }
+StopReason Simulation::run(const StopPolicy &policy) {
+  using clock = std::chrono::steady_clock;
+
+  // The wall clock is read before the first event and then every
+  // clock_check_interval events, so that a budget does not add a system call
+  // to every step. Budgets which reach beyond the range of the clock are
+  // treated as unlimited, and zero or negative budgets stop the run before
+  // the first event.
+  bool check_clock = false;
+  clock::time_point deadline;
+  if (policy.wall_clock_budget != clock::duration::max()) {
+    clock::time_point start = clock::now();
+    clock::duration budget =
+        std::max(policy.wall_clock_budget, clock::duration::zero());
+    if (budget < clock::time_point::max() - start) {
+      check_clock = true;
+      deadline = start + budget;
+    }
+  }
+  size_t clock_check_interval =
+      std::max<size_t>(policy.clock_check_interval, 1);
+  size_t next_clock_check = 0;
+
+  size_t events = 0;
+  StopReason reason;
+  while (true) {
+    if (queued_events.empty()) {
+      reason = StopReason::Empty;
+      break;
+    }
+    if (queued_events.front().time > policy.until) {
+      reason = StopReason::Until;
+      break;
+    }
+    if (events >= policy.max_events) {
+      return StopReason::MaxEvents;
+    }
+    if (policy.predicate && policy.predicate()) {
+      return StopReason::Predicate;
+    }
+    if (check_clock && events >= next_clock_check) {
+      next_clock_check += clock_check_interval;
+      if (clock::now() >= deadline) {
+        return StopReason::WallClock;
+      }
+    }
+
+    step();
+    ++events;
+  }
+
+  if (policy.until != std::numeric_limits<simtime>::infinity()) {
+    now = policy.until;
+  }
+  return reason;
+}
+
+simtime Simulation::get_now() {
+  if (has_parent) {
+    sync_clock();
+  }
+
+  return now;
+}
 
 bool Simulation::has_next() { return !queued_events.empty(); }
 
-simtime Simulation::peek_next_time() { return queued_events.top().time; }
+simtime Simulation::peek_next_time() { return queued_events.front().time; }
+
+size_t Simulation::get_step_count() { return step_count; }
+
+void Simulation::set_step_observer(StepObserver observer) {
+  step_observer = observer;
+}
+
+StepRecord Simulation::make_record(const QueuedEvent &queued_event) {
+  auto &event = queued_event.event;
+
+  StepRecord record;
+  record.time = queued_event.time;
+  record.id = queued_event.id;
+  record.kind = StepRecord::KindEvent;
+  record.process = 0;
+  if (queued_event.kind == EntryKind::Activation) {
+    record.fanout = 1;
+    return record;
+  }
+  if (queued_event.kind == EntryKind::Resume) {
+    auto process = static_cast<Process *>(event.get());
+    record.process = process->get_sequence_number();
+    record.kind |= StepRecord::KindProcess | StepRecord::KindResume;
+    if (event->is_pending()) {
+      record.fanout = 1;
+    } else {
+      record.kind |= StepRecord::KindSkipped;
+      record.fanout = 0;
+    }
+    return record;
+  }
+  auto process = dynamic_cast<Process *>(event.get());
+  if (process != nullptr) {
+    record.process = process->get_sequence_number();
+    record.kind |= StepRecord::KindProcess;
+  }
+  if (event->is_aborted() || event->is_processed()) {
+    record.kind |= StepRecord::KindSkipped;
+    record.fanout = 0;
+  } else {
+    record.fanout = static_cast<uint32_t>(event->get_handler_count());
+  }
+  return record;
+}
+
+void Simulation::sync_clock() {
+  auto parent = this->parent.lock();
+  if (parent) {
+    now = std::max(now, parent->get_now());
+  }
+}
+
+void Simulation::schedule_activation() {
+  if (!queued_events.empty()) {
+    Activation::schedule(activation, parent, this, &Simulation::activate,
+                         queued_events.front().time);
+  }
+}
+
+bool Simulation::activate(simtime time, simtime &next) {
+  now = time;
+  while (!queued_events.empty() && queued_events.front().time <= time) {
+    step();
+  }
+
+  if (queued_events.empty()) {
+    return false;
+  }
+  next = queued_events.front().time;
+  return true;
+}
+
+void Simulation::queue_activation(Activation *activation, simtime time) {
+  if (activation->position == Activation::not_scheduled) {
+    queued_events.emplace_back(time, next_id, activation->shared_from_this(),
+                               EntryKind::Activation);
+    ++scheduled_activations;
+    sift_up<true>(queued_events.size() - 1);
+  } else {
+    auto &queued_event = queued_events[activation->position];
+    if (queued_event.time <= time) {
+      return;
+    }
+    // A new id orders the moved entry like a newly scheduled one.
+    queued_event.time = time;
+    queued_event.id = next_id;
+    sift_up<true>(activation->position);
+  }
+  ++next_id;
+
+  if (has_parent) {
+    schedule_activation();
+  }
+}
+
+void Simulation::restore_heap(size_t old_size) {
+  size_t added = queued_events.size() - old_size;
+
+  // Sifting up each new entry costs O(added * log(size)), rebuilding the heap
+  // costs O(size). Rebuild once the batch is comparable to the old heap.
+  bool track = scheduled_activations > 0;
+  if (added >= old_size / 2) {
+    for (size_t i = queued_events.size() / 2; i > 0; --i) {
+      if (track) {
+        sift_down<true>(i - 1);
+      } else {
+        sift_down<false>(i - 1);
+      }
+    }
+    return;
+  }
+
+  for (size_t i = old_size; i < queued_events.size(); ++i) {
+    if (track) {
+      sift_up<true>(i);
+    } else {
+      sift_up<false>(i);
+    }
+  }
+}
 
 /* Simulation::QueuedEvent */
 
-Simulation::QueuedEvent::QueuedEvent(simtime time, size_t id, EventPtr event)
-    : time(time), id(id), event(event) {}
+Simulation::QueuedEvent::QueuedEvent(simtime time, size_t id, EventPtr event,
+                                     EntryKind kind)
+    : time(time), id(id), event(std::move(event)), kind(kind) {}
 
 bool Simulation::QueuedEvent::operator<(const QueuedEvent &other) const {
   if (time != other.time) {
@@ -110,6 +416,17 @@ bool Simulation::QueuedEvent::operator<(const QueuedEvent &other) const {
   return id > other.id;
 }
 
+/* StepRecord */
+
+bool StepRecord::operator==(const StepRecord &other) const {
+  return time == other.time && id == other.id && process == other.process &&
+         kind == other.kind && fanout == other.fanout;
+}
+
+bool StepRecord::operator!=(const StepRecord &other) const {
+  return !(*this == other);
+}
+
 /* Event */
 
 Event::Event(SimulationPtr sim) : sim(sim) {}
@@ -186,11 +503,14 @@ bool Event::is_aborted() { return state == State::Aborted; }
 
 Event::State Event::get_state() { return state; }
 
+size_t Event::get_handler_count() { return handlers.size(); }
+
 void Event::Aborted() {}
 
 /* Process */
 
-Process::Process(SimulationPtr sim) : Event(sim), Protothread() {}
+Process::Process(SimulationPtr sim)
+    : Event(sim), Protothread(), sequence_number(++sim->process_count) {}
 
 void Process::resume() {
   // Is the process already finished?
@@ -211,6 +531,47 @@ ProcessPtr Process::shared_from_this() {
   return std::static_pointer_cast<Process>(Event::shared_from_this());
 }
 
+size_t Process::get_sequence_number() { return sequence_number; }
+
+bool Process::wait_delay(simtime delay) {
+  if (delay == 0.0) {
+    return false;
+  }
+
+  auto sim = this->sim.lock();
+  sim->schedule_resume(shared_from_this(), delay);
+  return true;
+}
+
+/* Activation */
+
+Activation::Activation(SimulationPtr sim, Callback callback)
+    : Event(sim), callback(std::move(callback)) {}
+
+void Activation::schedule_at(simtime time) {
+  if (activating) {
+    return;
+  }
+
+  auto sim = this->sim.lock();
+  if (sim) {
+    sim->queue_activation(this, time);
+  }
+}
+
+bool Activation::is_scheduled() { return position != not_scheduled; }
+
+void Activation::activate(simtime time) {
+  activating = true;
+  simtime next;
+  bool left = callback(time, next);
+  activating = false;
+
+  if (left) {
+    schedule_at(next);
+  }
+}
+
 /* Condition */
 
 Condition::Condition(SimulationPtr sim, int n) : Process(sim), n(n) {}
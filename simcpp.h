@@ -4,9 +4,13 @@
 #ifndef SIMCPP_H_
 #define SIMCPP_H_
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
-#include <queue>
 #include <vector>
 
 #include "protothread.h"
@@ -27,6 +31,22 @@
     }                                                                          \
   } while (0)
 
+/**
+ * Pause the process for a delay inside the Run method of a process.
+ *
+ * This has the same effect as PROC_WAIT_FOR(sim->timeout(delay)), but the
+ * process itself is scheduled to be resumed, so no event is created. Like a
+ * timeout with delay 0, a delay of 0 does not pause the process.
+ *
+ * @param delay Delay after which the process is resumed.
+ */
+#define PROC_WAIT_DELAY(delay)                                                 \
+  do {                                                                         \
+    if (wait_delay(delay)) {                                                   \
+      PT_YIELD();                                                              \
+    }                                                                          \
+  } while (0)
+
 namespace simcpp {
 
 using simtime = double;
@@ -43,8 +63,87 @@ class Simulation;
 using SimulationPtr = std::shared_ptr<Simulation>;
 using SimulationWeakPtr = std::weak_ptr<Simulation>;
 
+class Activation;
+using ActivationPtr = std::shared_ptr<Activation>;
+using ActivationWeakPtr = std::weak_ptr<Activation>;
+
 using Handler = std::function<void(EventPtr)>;
 
+/// Summary of a queue entry processed by Simulation::step.
+class StepRecord {
+public:
+  /// Flags stored in the kind field.
+  enum Kind : uint32_t {
+    /// The entry is a plain event.
+    KindEvent = 0,
+    /// The entry is a process.
+    KindProcess = 1 << 0,
+    /// The entry was skipped because it was already processed or aborted.
+    KindSkipped = 1 << 1,
+    /// The entry resumes a process directly (see PROC_WAIT_DELAY).
+    KindResume = 1 << 2
+  };
+
+  /// Time at which the entry was processed.
+  simtime time;
+  /// Scheduling id of the entry. Ids are unique within a simulation.
+  uint64_t id;
+  /**
+   * Sequence number of the process (see Process::get_sequence_number), or 0
+   * if the entry is not a process.
+   */
+  uint64_t process;
+  /// Combination of Kind flags.
+  uint32_t kind;
+  /// Number of handlers called when processing the entry.
+  uint32_t fanout;
+
+  bool operator==(const StepRecord &other) const;
+  bool operator!=(const StepRecord &other) const;
+};
+
+using StepObserver = std::function<void(const StepRecord &)>;
+
+/// Conditions under which Simulation::run stops. All conditions are optional.
+class StopPolicy {
+public:
+  /// Stop before processing events scheduled after this time.
+  simtime until = std::numeric_limits<simtime>::infinity();
+
+  /// Stop after processing this many events.
+  size_t max_events = std::numeric_limits<size_t>::max();
+
+  /**
+   * Stop once this much wall-clock time has passed. A zero or negative budget
+   * stops the run before the first event.
+   */
+  std::chrono::steady_clock::duration wall_clock_budget =
+      std::chrono::steady_clock::duration::max();
+
+  /**
+   * Number of events between two checks of the wall-clock budget. The budget
+   * is also checked before the first event.
+   */
+  size_t clock_check_interval = 1024;
+
+  /// Stop before processing the next event when this returns true.
+  std::function<bool()> predicate;
+};
+
+/// Reason why Simulation::run stopped.
+enum class StopReason {
+  /// No scheduled events are left.
+  Empty,
+  /// The next event is scheduled after StopPolicy::until.
+  Until,
+  /// StopPolicy::max_events events were processed.
+  MaxEvents,
+  /// StopPolicy::wall_clock_budget was exhausted.
+  WallClock,
+  /// StopPolicy::predicate returned true.
+  Predicate
+};
+
 /// Simulation environment.
 class Simulation : public std::enable_shared_from_this<Simulation> {
 public:
@@ -55,6 +154,27 @@ public:
    */
   static SimulationPtr create();
 
+  /**
+   * Create a sub-simulation which shares the clock of this simulation.
+   *
+   * The events of the sub-simulation are kept in its own queue. This
+   * simulation only holds a single activation entry for the earliest event of
+   * the sub-simulation, and none while the sub-simulation is idle (see
+   * Activation). An idle sub-simulation is not referenced by this simulation
+   * and is destroyed when the last pointer to it is released.
+   *
+   * When the activation entry is processed, all events of the sub-simulation
+   * which are due at that time are processed. The order of these events
+   * relative to events of this simulation at the same time follows the
+   * scheduling order of the activation entry, which is scheduled again
+   * whenever it moves to an earlier time.
+   *
+   * The sub-simulation must not be run directly; run this simulation instead.
+   *
+   * @return Simulation instance.
+   */
+  SimulationPtr create_sub_simulation();
+
   /**
    * Construct a process and run it immediately.
    *
@@ -86,6 +206,33 @@ public:
     return process;
   }
 
+  /**
+   * Construct one process per element of a range and run them after a delay.
+   *
+   * Each process is constructed with the simulation instance and the element
+   * as arguments. The processes are run in the order of the range.
+   *
+   * @tparam T Process class. Must be a subclass of Process.
+   * @tparam Iterator Input iterator type.
+   * @param first Beginning of the range.
+   * @param last End of the range.
+   * @param delay Delay after which to run the processes.
+   * @return Process instances.
+   */
+  template <typename T, typename Iterator>
+  std::vector<std::shared_ptr<T>> start_processes(Iterator first,
+                                                  Iterator last,
+                                                  simtime delay = 0.0) {
+    std::vector<std::shared_ptr<T>> processes;
+    reserve_for(processes, first, last,
+                typename std::iterator_traits<Iterator>::iterator_category());
+    for (; first != last; ++first) {
+      processes.push_back(std::make_shared<T>(shared_from_this(), *first));
+    }
+    run_processes(processes.begin(), processes.end(), delay);
+    return processes;
+  }
+
   /**
    * Run a process after a delay.
    *
@@ -94,6 +241,21 @@ public:
    */
   void run_process(ProcessPtr process, simtime delay = 0.0);
 
+  /**
+   * Run a range of processes after a delay.
+   *
+   * All processes share a single start event, so only one entry is scheduled
+   * regardless of the number of processes. The processes are run in the order
+   * of the range.
+   *
+   * @tparam Iterator Input iterator over process pointers.
+   * @param first Beginning of the range.
+   * @param last End of the range.
+   * @param delay Delay after which to run the processes.
+   */
+  template <typename Iterator>
+  void run_processes(Iterator first, Iterator last, simtime delay = 0.0);
+
   /**
    * Construct an event.
    *
@@ -144,6 +306,61 @@ public:
    */
   void schedule(EventPtr event, simtime delay = 0.0);
 
+  /**
+   * Schedule a process to be resumed after a delay.
+   *
+   * Unlike waiting for a timeout, no event is created: the process itself is
+   * queued and its resume method is called directly.
+   *
+   * @param process Process instance.
+   * @param delay Delay after which the process is resumed.
+   */
+  void schedule_resume(ProcessPtr process, simtime delay);
+
+  /**
+   * Schedule a range of events to be processed after a delay.
+   *
+   * The events are appended to the queue. If the batch holds at least half as
+   * many entries as the queue did before, the queue is rebuilt once, which is
+   * linear in its size. Otherwise, the new entries are sifted up one by one,
+   * which is cheaper for small batches. The events are processed in the order
+   * of the range. Unlike Event::trigger, the state of the events is not
+   * changed.
+   *
+   * @tparam Iterator Input iterator over event pointers.
+   * @param first Beginning of the range.
+   * @param last End of the range.
+   * @param delay Delay after which the events are processed.
+   */
+  template <typename Iterator>
+  void schedule_many(Iterator first, Iterator last, simtime delay = 0.0) {
+    if (has_parent) {
+      sync_clock();
+    }
+    size_t old_size = queued_events.size();
+    reserve_for(queued_events, first, last,
+                typename std::iterator_traits<Iterator>::iterator_category());
+    for (; first != last; ++first) {
+      queued_events.emplace_back(now + delay, next_id, *first,
+                                 EntryKind::Event);
+      ++next_id;
+    }
+    restore_heap(old_size);
+    if (has_parent) {
+      schedule_activation();
+    }
+  }
+
+  /**
+   * Reserve space in the event queue.
+   *
+   * Use this before scheduling a large number of events to avoid repeated
+   * reallocation of the queue.
+   *
+   * @param capacity Number of queue entries to reserve space for.
+   */
+  void reserve(size_t capacity);
+
   /**
    * Process the next scheduled event.
    *
@@ -170,6 +387,18 @@ public:
   /// Run the simulation until no scheduled events are left.
   void run();
 
+  /**
+   * Run the simulation until a stop condition is met.
+   *
+   * If StopPolicy::until is set and the simulation stops because of it or
+   * because no scheduled events are left, the simulation time is advanced to
+   * StopPolicy::until, as with advance_by.
+   *
+   * @param policy Stop conditions.
+   * @return Reason why the simulation stopped.
+   */
+  StopReason run(const StopPolicy &policy);
+
   /// @return Current simulation time.
   simtime get_now();
 
@@ -179,21 +408,117 @@ public:
   /// @return Time at which the next event is scheduled.
   simtime peek_next_time();
 
+  /// @return Number of queue entries processed so far.
+  size_t get_step_count();
+
+  /**
+   * Set a callback which is called for every queue entry processed by step.
+   *
+   * The callback is called before the entry is processed, so the record of
+   * the entry is available even if processing it fails.
+   *
+   * @param observer Callback receiving a record of the entry. Pass nullptr to
+   * remove the observer.
+   */
+  void set_step_observer(StepObserver observer);
+
 private:
+  friend class Activation;
+  friend class Process;
+
+  enum class EntryKind : uint8_t {
+    // The event is processed.
+    Event,
+    // The event is a process, which is resumed.
+    Resume,
+    // The event is an activation, whose position in the queue is tracked.
+    Activation
+  };
+
   class QueuedEvent {
   public:
     simtime time;
     size_t id;
     EventPtr event;
+    EntryKind kind;
 
-    QueuedEvent(simtime time, size_t id, EventPtr event);
+    QueuedEvent(simtime time, size_t id, EventPtr event, EntryKind kind);
 
     bool operator<(const QueuedEvent &other) const;
   };
 
   simtime now = 0.0;
   size_t next_id = 0;
-  std::priority_queue<QueuedEvent> queued_events;
+  size_t step_count = 0;
+  size_t process_count = 0;
+
+  // Parent of a sub-simulation and the activation entry in the parent.
+  bool has_parent = false;
+  SimulationWeakPtr parent;
+  ActivationWeakPtr activation;
+
+  // Binary heap ordered by QueuedEvent::operator<. It is maintained by
+  // sift_up and sift_down instead of the <algorithm> heap functions, so that
+  // the positions of activation entries can be kept up to date.
+  std::vector<QueuedEvent> queued_events;
+  // Number of activation entries in the heap. While there are none, the heap
+  // functions are instantiated without tracking positions, which keeps a
+  // check off the hot path.
+  size_t scheduled_activations = 0;
+  StepObserver step_observer;
+
+  void push(simtime delay, EventPtr event, EntryKind kind);
+
+  // The heap functions record the positions of activation entries if Track
+  // is set, which is required while scheduled_activations is not 0.
+
+  template <bool Track> QueuedEvent pop();
+
+  template <bool Track>
+  void place(size_t position, QueuedEvent &&queued_event);
+
+  template <bool Track> void sift_up(size_t position);
+
+  template <bool Track> void sift_down(size_t position);
+
+  // Schedule an activation at a time, or move its entry there if it is
+  // scheduled later.
+  void queue_activation(Activation *activation, simtime time);
+
+  StepRecord make_record(const QueuedEvent &queued_event);
+
+  // Catch up with the clock of the parent simulation.
+  void sync_clock();
+
+  // Make sure the parent holds an activation entry for the earliest event.
+  void schedule_activation();
+
+  // Process all events which are due at the activation time. Used as
+  // Activation::Callback.
+  bool activate(simtime time, simtime &next);
+
+  // Restore the heap property after entries were appended behind the first
+  // old_size entries.
+  void restore_heap(size_t old_size);
+
+  // Reserve space for the elements of a range in a vector, if the length of
+  // the range can be determined without consuming it. The capacity grows at
+  // least geometrically, so that repeated small batches stay amortized linear.
+  template <typename Element, typename Iterator>
+  static void reserve_for(std::vector<Element> &vector, Iterator first,
+                          Iterator last,
+                          std::forward_iterator_tag /* unused */) {
+    size_t needed =
+        vector.size() + static_cast<size_t>(std::distance(first, last));
+    if (needed > vector.capacity()) {
+      vector.reserve(std::max(needed, 2 * vector.capacity()));
+    }
+  }
+
+  template <typename Element, typename Iterator>
+  static void reserve_for(std::vector<Element> & /* unused */,
+                          Iterator /* unused */, Iterator /* unused */,
+                          std::input_iterator_tag /* unused */) {}
 };
 
 /**
@@ -291,6 +616,9 @@ public:
   /// @return Whether the event is pending.
   State get_state();
 
+  /// @return Number of handlers waiting for the event to be processed.
+  size_t get_handler_count();
+
   /// Called when the event is aborted.
   virtual void Aborted();
 
@@ -328,6 +656,27 @@ public:
 
   /// @return Shared pointer to the process instance.
   ProcessPtr shared_from_this();
+
+  /**
+   * @return Sequence number of the process. Processes are numbered from 1 in
+   * the order in which they are constructed in their simulation, so a replay
+   * which sets up the simulation in the same way assigns the same numbers.
+   */
+  size_t get_sequence_number();
+
+protected:
+  /**
+   * Schedule the process to be resumed after a delay. Used by
+   * PROC_WAIT_DELAY.
+   *
+   * @param delay Delay after which the process is resumed.
+   * @return Whether the process was scheduled and should pause. A delay of 0
+   * does not schedule the process, matching a triggered timeout.
+   */
+  bool wait_delay(simtime delay);
+
+private:
+  size_t sequence_number;
 };
 
 /// Condition process used for Simulation::any_of and Simulation::all_of.
@@ -352,6 +701,116 @@ private:
   int n;
 };
 
+/**
+ * Queue entry which represents a nested event queue in a simulation.
+ *
+ * Sub-simulations (see Simulation::create_sub_simulation) and CompactScheduler
+ * keep their events in a queue of their own and are represented in their
+ * simulation by a single activation for the earliest of these events. When an
+ * earlier event is added to the nested queue, the entry of the activation is
+ * moved to the new time in place, so the simulation never holds more than one
+ * entry per activation. Like a newly scheduled event, the moved entry is
+ * processed after the entries already scheduled for the same time.
+ *
+ * The simulation references the activation only while it is scheduled or
+ * processed. If the callback keeps the owner of the nested queue alive, the
+ * owner is therefore released once its queue is empty.
+ */
+class Activation : public Event {
+public:
+  /**
+   * Function which processes the nested events that are due at a time.
+   *
+   * It receives the time of the activation. If nested events are left, it
+   * stores the time of the earliest one in its second argument and returns
+   * true, after which the activation is scheduled at that time.
+   */
+  using Callback = std::function<bool(simtime, simtime &)>;
+
+  /**
+   * Construct an activation. It is not scheduled until schedule_at is called.
+   *
+   * @param sim Simulation instance.
+   * @param callback Function called when the activation is processed.
+   */
+  Activation(SimulationPtr sim, Callback callback);
+
+  /**
+   * Schedule the activation at a time, or move it there if it is scheduled
+   * later.
+   *
+   * Nothing is done while the callback runs, as the activation is then
+   * scheduled from the return value of the callback.
+   *
+   * @param time Time of the earliest nested event.
+   */
+  void schedule_at(simtime time);
+
+  /// @return Whether the activation is scheduled.
+  bool is_scheduled();
+
+  /**
+   * Schedule the activation of a nested queue at the time of its earliest
+   * event, or move it there if it is scheduled later.
+   *
+   * If the activation of the owner has expired, a new one is created and
+   * stored. Its callback calls a method of the owner and keeps the owner alive
+   * while the activation is scheduled.
+   *
+   * @tparam Owner Class of the owner. Must be owned by a shared pointer and
+   * offer shared_from_this.
+   * @param activation Activation of the owner.
+   * @param sim Simulation which holds the activation.
+   * @param owner Owner of the nested queue.
+   * @param method Method of the owner used as callback.
+   * @param time Time of the earliest nested event.
+   */
+  template <typename Owner>
+  static void schedule(ActivationWeakPtr &activation, SimulationWeakPtr sim,
+                       Owner *owner, bool (Owner::*method)(simtime, simtime &),
+                       simtime time) {
+    auto current = activation.lock();
+    if (!current) {
+      auto shared_sim = sim.lock();
+      if (!shared_sim) {
+        return;
+      }
+
+      auto self = owner->shared_from_this();
+      current = shared_sim->event<Activation>(
+          [self, method](simtime at, simtime &next) {
+            return ((*self).*method)(at, next);
+          });
+      activation = current;
+    }
+    current->schedule_at(time);
+  }
+
+private:
+  friend class Simulation;
+
+  static const size_t not_scheduled = std::numeric_limits<size_t>::max();
+
+  Callback callback;
+  // Index of the entry in the queue of the simulation.
+  size_t position = not_scheduled;
+  bool activating = false;
+
+  void activate(simtime time);
+};
+
+/* Simulation template definitions which need the complete Event class */
+
+template <typename Iterator>
+void Simulation::run_processes(Iterator first, Iterator last,
+                               simtime delay /* = 0.0 */) {
+  auto event = this->event();
+  for (; first != last; ++first) {
+    event->add_handler(ProcessPtr(*first));
+  }
+  event->trigger(delay);
+}
+
 } // namespace simcpp
 
 #endif // SIMCPP_H_